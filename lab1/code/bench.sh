@@ -0,0 +1,19 @@
+#! /bin/bash
+# Sweeps the number of philosophers and prints one CSV row per run.
+# usage: [BACKEND=mpi|rma|threads|sim] [SIM_RANKS=n] ./bench.sh "2 4 8 16" [drinking-phil options...]
+
+RANKS=${1:-"2 4 8 16"}
+shift
+
+mpicxx -O2 -pthread -o drinking-phil drinking-phil.cpp || exit 1
+
+echo "philosophers,meals,elapsed_s,meals_per_sec,msgs_per_meal,p50_ms,p90_ms,p99_ms,max_starvation_ms,cross_node_per_meal"
+for n in $RANKS; do
+    if [ "$BACKEND" = "threads" ]; then
+        ./drinking-phil -b -B threads -p $n "$@"
+    elif [ "$BACKEND" = "sim" ]; then
+        mpiexec -n ${SIM_RANKS:-1} ./drinking-phil -B sim -p $n "$@"
+    else
+        mpiexec -n $n ./drinking-phil -b -B ${BACKEND:-mpi} "$@"
+    fi | grep '^csv: ' | cut -c6-
+done
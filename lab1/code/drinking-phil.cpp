@@ -1,100 +1,171 @@
 #include "mpi.h"
-#include <cstdlib>
-#include <cstdio>
-#include <ctime>
-#include <map>
-#include <stack>
-#include <unistd.h>
-#include <vector>
-
-using std::map;
-using std::stack;
-using std::vector;
-
-struct Fork {
-    int id;
-    bool clean;
-    int owner;
-    int alt_owner;
-
-    Fork() {}
-    Fork(int _id, bool _clean, int _owner, int _alt_owner) :
-        id(_id), clean(_clean), owner(_owner), alt_owner(_alt_owner) {}
-};
-
-struct ForkMessage{
-    int id;
-    int sender;
-    int type;
-
-    ForkMessage() {}
-    ForkMessage(int _id, int _sender, int _type) : id(_id), sender(_sender), type(_type) {}
-};
-
-#define FORK_REQUEST 0
-#define FORK_RESPONSE 1
-
-inline void _print_spaces(int i){
-    while(i--) putchar(' ');
+#include <cstring>
+#include "philosopher.h"
+#include "mpi-transport.h"
+#include "thread-transport.h"
+#include "simulation.h"
+#include "rma-philosopher.h"
+#include "topology.h"
+
+#define REPORT_MAX_ROWS 64      // per-philosopher starvation is listed only for small tables
+
+void usage(const char *prog){
+    fprintf(stderr,
+        "usage: %s [-B mpi|rma|threads|sim] [-p philosophers] [-l latency_us] [-j jitter_us]\n"
+        "          [-b] [-m meals] [-d seconds] [-s seed] [-t think_ms] [-e eat_ms] [-x] [-v]\n"
+        "          [-L log_prefix] [-R]\n"
+        "  -B  transport: one philosopher per MPI rank with messages (default) or with fork\n"
+        "      state in an RMA window, threads of one process, or a discrete-event\n"
+        "      simulation in virtual time sharded over the ranks\n"
+        "  -p  number of philosophers for the threads and sim backends (default 5)\n"
+        "  -l  sim: minimum message latency in us (default 50); it is the lookahead\n"
+        "      between ranks, so it has to be > 0 when the sim runs on several ranks\n"
+        "  -j  sim: mean extra exponential message latency in us (default 0)\n"
+        "  -b  benchmark mode: bounded run, prints statistics at the end\n"
+        "  -m  stop after this many meals per philosopher\n"
+        "  -d  stop after this many seconds (default 10 in benchmark mode, virtual for sim)\n"
+        "  -s  random seed (default 1)\n"
+        "  -t  mean thinking time in ms (default 2500)\n"
+        "  -e  mean eating time in ms (default 0)\n"
+        "  -x  exponential instead of uniform think/eat times\n"
+        "  -v  keep printing the per-event output in benchmark mode\n"
+        "  -L  write per-event output to binary logs <log_prefix>.<rank> instead of stdout;\n"
+        "      read them with log-merge\n"
+        "  -R  seat ranks by rank number instead of keeping each node's ranks together\n", prog);
 }
 
-#define MSG_PRINT(format, ...) \
-do{ \
-    printf("<process %d> :: " format "\n", k, ##__VA_ARGS__ ); \
-    fflush(stdout); \
-} while(0)
-
-#define STAT_PRINT(format, ...) \
-do{ \
-    _print_spaces(k); \
-    printf(format "\n", ##__VA_ARGS__ ); \
-    fflush(stdout); \
-} while(0)
-
-#define DUMP_VECTOR(v) \
-do{ \
-    printf("<process %d forks> ::\n", k); \
-    for(vector<Fork>::const_iterator it = v.begin(); it != v.end(); ++it) \
-        printf("{%d, %c, (%d) <-> %d}, ", it->id, it->clean ? 'T' : 'F', it->owner, it->alt_owner); \
-    printf("\n"); \
-    fflush(stdout); \
-} while(0)
-
-void parse_request(ForkMessage msg, vector<Fork> &forks, stack<ForkMessage> &requests, int k){
-    // MSG_PRINT("Parsing a request: {%s, F=%d, S=%d}", msg.type ? "RES" : "REQ", msg.id, msg.sender);
-    for(int i = 0; i < 2; ++i)
-        if(forks[i].id == msg.id){
-            if(forks[i].owner == k){
-                if(!forks[i].clean){
-                    ForkMessage outbound = ForkMessage(forks[i].id, k, FORK_RESPONSE);
-                    // MSG_PRINT("Passing the fork %d to %d.", msg.id, msg.sender);
-                    forks[i].owner = msg.sender;
-                    forks[i].alt_owner = k;
-                    forks[i].clean = true;
-                    MPI_Send(&outbound, sizeof(ForkMessage), MPI_BYTE, msg.sender, 0, MPI_COMM_WORLD);
-                } else {
-                    requests.push(msg);
-                }
-            } else { // I don't have it yet
-                requests.push(msg);
-            }
+bool parse_args(int argc, char *argv[], BenchConfig &cfg){
+    int opt;
+    bool verbose = false;
+    while((opt = getopt(argc, argv, "B:p:l:j:bm:d:s:t:e:xvL:R")) != -1){
+        switch(opt){
+            case 'B':
+                if(strcmp(optarg, "mpi") == 0) cfg.backend = BACKEND_MPI;
+                else if(strcmp(optarg, "threads") == 0) cfg.backend = BACKEND_THREADS;
+                else if(strcmp(optarg, "sim") == 0) cfg.backend = BACKEND_SIM;
+                else if(strcmp(optarg, "rma") == 0) cfg.backend = BACKEND_RMA;
+                else return false;
+                break;
+            case 'p': cfg.philosophers = atoi(optarg); break;
+            case 'l': cfg.latency_us = atof(optarg); break;
+            case 'j': cfg.jitter_us = atof(optarg); break;
+            case 'b': cfg.enabled = true; break;
+            case 'm': cfg.meals = atoi(optarg); break;
+            case 'd': cfg.duration = atof(optarg); break;
+            case 's': cfg.seed = strtoul(optarg, NULL, 10); break;
+            case 't': cfg.think_ms = atoi(optarg); break;
+            case 'e': cfg.eat_ms = atoi(optarg); break;
+            case 'x': cfg.exponential = true; break;
+            case 'v': verbose = true; break;
+            case 'L': cfg.log_prefix = optarg; break;
+            case 'R': cfg.reorder = false; break;
+            default: return false;
         }
+    }
+    if(cfg.philosophers < 1 || cfg.latency_us < 0 || cfg.jitter_us < 0)
+        return false;
+    if(cfg.meals > 0 || cfg.duration > 0 || cfg.backend == BACKEND_SIM)
+        cfg.enabled = true;
+    if(cfg.enabled){
+        cfg.verbose = verbose;
+        if(cfg.meals <= 0 && cfg.duration <= 0)
+            cfg.duration = 10;
+    }
+    return true;
 }
 
-void parse_response(ForkMessage msg, vector<Fork> &forks, int k){
-    // MSG_PRINT("Parsing a response: {%s, F=%d, S=%d}", msg.type ? "RES" : "REQ", msg.id, msg.sender);
-    for(int i = 0; i < 2; ++i)
-        if(forks[i].id == msg.id){
-            forks[i].clean = true;
-            forks[i].owner = k;
-            forks[i].alt_owner = msg.sender;
-        }
-    // MSG_PRINT("Got a fork %d from %d.", msg.id, msg.sender);
+// Upper edge of the histogram bucket holding the p-th percentile, in ms.
+double percentile(const long long *hist, double p){
+    long long total = 0;
+    for(int i = 0; i < LATENCY_BUCKETS; ++i) total += hist[i];
+
+    long long seen = 0, target = (long long) ceil(p * total);
+    for(int i = 0; i < LATENCY_BUCKETS; ++i){
+        seen += hist[i];
+        if(seen >= target && seen > 0)
+            return pow(2.0, (i + 1) / 4.0) / 1000;
+    }
+    return 0;
+}
+
+void print_report(const BenchConfig &cfg, int N, const Stats &total, const vector<double> &starvation,
+                  const Topology *topo){
+    double meals_per_sec = total.elapsed > 0 ? total.meals / total.elapsed : 0;
+    double msgs_per_meal = total.meals > 0 ? (double) total.messages / total.meals : 0;
+    double cross_per_meal = total.meals > 0 ? (double) total.cross_node / total.meals : 0;
+    double p50 = percentile(total.latency, 0.50);
+    double p90 = percentile(total.latency, 0.90);
+    double p99 = percentile(total.latency, 0.99);
+
+    const char *backends[] = {"mpi", "threads", "sim", "rma"};
+    printf("backend         %s\n", backends[cfg.backend]);
+    if(cfg.backend == BACKEND_SIM)
+        printf("latency (us)    %.1f + exp(%.1f)\n", cfg.latency_us, cfg.jitter_us);
+    printf("philosophers    %d\n", N);
+    if(topo && cfg.backend != BACKEND_SIM)
+        printf("nodes           %d, %s\n", topo->nodes, cfg.reorder ? "seated by node" : "seated by rank");
+    printf("seed            %u\n", cfg.seed);
+    printf("think/eat (ms)  %d/%d %s\n", cfg.think_ms, cfg.eat_ms, cfg.exponential ? "exponential" : "uniform");
+    printf("elapsed (s)     %.3f\n", total.elapsed);
+    printf("meals           %lld\n", total.meals);
+    printf("meals/sec       %.2f\n", meals_per_sec);
+    if(cfg.backend == BACKEND_RMA)
+        printf("remote ops/meal %.3f\n", msgs_per_meal);
+    else
+        printf("messages/meal   %.3f\n", msgs_per_meal);
+    if(topo && cfg.backend != BACKEND_SIM)
+        printf("cross-node/meal %.3f\n", cross_per_meal);
+    printf("hungry->eating  p50 %.3f ms, p90 %.3f ms, p99 %.3f ms\n", p50, p90, p99);
+    printf("max starvation  %.3f ms\n", total.max_starvation * 1000);
+    for(int i = 0; N <= REPORT_MAX_ROWS && i < N; ++i)
+        printf("  philosopher %-4d %.3f ms\n", i, starvation[i] * 1000);
+    printf("csv: %d,%lld,%.3f,%.2f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f\n",
+        N, total.meals, total.elapsed, meals_per_sec, msgs_per_meal, p50, p90, p99, total.max_starvation * 1000,
+        cross_per_meal);
+}
+
+// Reduces the statistics of the philosophers living in each rank to seat 0.
+void report(const BenchConfig &cfg, const vector<Stats> &local, int N, const Topology &topo){
+    MPI_Comm comm = topo.ring;
+    int size, count = local.size();
+    Stats stats, total;
+    vector<double> mine, starvation(N);
+
+    for(size_t i = 0; i < local.size(); ++i){
+        stats.merge(local[i]);
+        mine.push_back(local[i].max_starvation);
+    }
+    mine.push_back(0);
+
+    MPI_Reduce(&stats.meals, &total.meals, 1, MPI_LONG_LONG, MPI_SUM, 0, comm);
+    MPI_Reduce(&stats.messages, &total.messages, 1, MPI_LONG_LONG, MPI_SUM, 0, comm);
+    MPI_Reduce(&stats.cross_node, &total.cross_node, 1, MPI_LONG_LONG, MPI_SUM, 0, comm);
+    MPI_Reduce(&stats.max_starvation, &total.max_starvation, 1, MPI_DOUBLE, MPI_MAX, 0, comm);
+    MPI_Reduce(&stats.elapsed, &total.elapsed, 1, MPI_DOUBLE, MPI_MAX, 0, comm);
+    MPI_Reduce(stats.latency, total.latency, LATENCY_BUCKETS, MPI_LONG_LONG, MPI_SUM, 0, comm);
+
+    MPI_Comm_size(comm, &size);
+    vector<int> counts(size), displs(size);
+    MPI_Gather(&count, 1, MPI_INT, &counts[0], 1, MPI_INT, 0, comm);
+    for(int r = 1; r < size; ++r)
+        displs[r] = displs[r - 1] + counts[r - 1];
+    MPI_Gatherv(&mine[0], count, MPI_DOUBLE, &starvation[0], &counts[0], &displs[0], MPI_DOUBLE, 0, comm);
+
+    if(topo.seat == 0)
+        print_report(cfg, N, total, starvation, &topo);
+}
+
+void open_log(const BenchConfig &cfg, int k){
+    if(cfg.log_prefix && !event_log().open(cfg.log_prefix, k)){
+        perror(cfg.log_prefix);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
 }
 
 int main(int argc, char *argv[]){
     int N, k, name_len;
     char processor_name[32];
+    BenchConfig cfg;
 
     MPI_Init(&argc, &argv);
 
@@ -102,88 +173,65 @@ int main(int argc, char *argv[]){
     MPI_Comm_rank(MPI_COMM_WORLD, &k);
     MPI_Get_processor_name(processor_name, &name_len);
 
-    vector<Fork> my_forks;
-    stack<ForkMessage> requests;
-
-    if(k == 0){
-        my_forks.push_back(Fork(0, false, 0, 1));
-        my_forks.push_back(Fork(1, false, 0, 1));
-    } else if(k == N-1){
-        my_forks.push_back(Fork(N - 1, false, N - 2, N - 1));
-        my_forks.push_back(Fork(0, false, 0, N - 1));
-    } else {
-        my_forks.push_back(Fork(k, false, k - 1, k));
-        my_forks.push_back(Fork(k + 1, false, k, k + 1));
+    // the sharded sim needs a positive lookahead to make progress
+    if(!parse_args(argc, argv, cfg) || (cfg.backend == BACKEND_SIM && N > 1 && cfg.latency_us <= 0)){
+        if(k == 0) usage(argv[0]);
+        MPI_Finalize();
+        return 1;
     }
 
-    srand(k + 1);
-
-    // MSG_PRINT("Starting; my fork ids are = (%d, %d)", my_forks[0].id, my_forks[1].id);
-
-    int sleep_time, c_time = 0, sleep_count = 10;
-
-    while(true){
-        // DUMP_VECTOR(my_forks);
-        sleep_time = rand() % 500 * 10;
-        c_time = 0;
-
-        // MSG_PRINT("Going to think!");
-        // printf("\n");
-
-        STAT_PRINT("mislim");
-
-        while(c_time < sleep_time){
-            usleep(10000);
-            c_time += 10;
-            int flag;
-            MPI_Iprobe(MPI_ANY_SOURCE, MPI_ANY_TAG, MPI_COMM_WORLD, &flag, MPI_STATUS_IGNORE);
-            if(flag){
-                // MSG_PRINT("Received a message while sleeping.");
-                ForkMessage incoming;
-                MPI_Recv(&incoming, sizeof(ForkMessage), MPI_BYTE, MPI_ANY_SOURCE, MPI_ANY_TAG, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-                parse_request(incoming, my_forks, requests, k);
-            }
-        }
-
-        // MSG_PRINT("Thought for <%dms>, now want to eat!", sleep_time);
-
-        bool has_all = false;
-        while(!has_all){
-            has_all = true;
-            for(int i = 0; i < 2; ++i){
-                if(my_forks[i].owner != k){
-                    // MSG_PRINT("I don't have a fork %d! -> Asking %d for it.", my_forks[i].id, my_forks[i].owner);
-                    STAT_PRINT("trazim vilicu (%d)", my_forks[i].id);
-                    ForkMessage outbound = ForkMessage(my_forks[i].id, k, FORK_REQUEST);
-                    MPI_Send(&outbound, sizeof(ForkMessage), MPI_BYTE, my_forks[i].owner, 0, MPI_COMM_WORLD);
-                    has_all = false;
-
-                    while(my_forks[i].owner != k){
-                        ForkMessage incoming;
-                        MPI_Recv(&incoming, sizeof(ForkMessage), MPI_BYTE, MPI_ANY_SOURCE, MPI_ANY_TAG, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-                        if(incoming.type == FORK_RESPONSE)
-                            parse_response(incoming, my_forks, k);
-                        else
-                            parse_request(incoming, my_forks, requests, k);
-                    }
+    if(cfg.backend == BACKEND_THREADS){
+        // the whole table lives in rank 0
+        if(k == 0){
+            open_log(cfg, k);
+            vector<Stats> stats = run_threads(cfg);
+            event_log().close();
+            if(cfg.enabled){
+                Stats total;
+                vector<double> starvation;
+                for(size_t i = 0; i < stats.size(); ++i){
+                    total.merge(stats[i]);
+                    starvation.push_back(stats[i].max_starvation);
                 }
+                print_report(cfg, cfg.philosophers, total, starvation, NULL);
             }
-
         }
+        MPI_Finalize();
+        return 0;
+    }
 
-        //MSG_PRINT("I have all the forks, EATING!");
-        STAT_PRINT("jedem");
-
-        for(int i = 0; i < 2; ++i)
-            my_forks[i].clean = false;
-
-        while(!requests.empty()){
-            ForkMessage top = requests.top(); requests.pop();
-            ForkMessage outbound = ForkMessage(top.id, k, FORK_REQUEST);
-            MPI_Send(&outbound, sizeof(ForkMessage), MPI_BYTE, top.sender, 0, MPI_COMM_WORLD);
+    {   // communicators and windows have to be freed before MPI_Finalize
+        Topology topo(cfg.reorder);
+        k = topo.seat;      // from here on, the philosopher's place at the table
+        open_log(cfg, k);
+
+        if(cfg.backend == BACKEND_SIM){
+            Simulation sim(cfg, topo.ring);
+            event_log().virtual_clock = &sim.clock;
+            sim.run();
+            event_log().close();
+            report(cfg, sim.stats(), cfg.philosophers, topo);
+        } else if(cfg.backend == BACKEND_RMA){
+            RmaPhilosopher philosopher(topo, cfg);     // synchronizes the ranks
+            philosopher.run();
+            event_log().close();
+            if(cfg.enabled)
+                report(cfg, vector<Stats>(1, philosopher.stats), N, topo);
+        } else {
+            MpiTransport transport(topo);
+            Philosopher philosopher(k, N, transport, cfg);
+
+            // MSG_PRINT("Starting; my fork ids are = (%d, %d)", philosopher.forks[0].id, philosopher.forks[1].id);
+
+            if(cfg.enabled) MPI_Barrier(topo.ring);
+            philosopher.run();
+            event_log().close();
+
+            if(cfg.enabled)
+                report(cfg, vector<Stats>(1, philosopher.stats), N, topo);
         }
     }
 
     MPI_Finalize();
     return 0;
-}
\ No newline at end of file
+}
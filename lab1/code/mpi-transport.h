@@ -0,0 +1,58 @@
+#ifndef MPI_TRANSPORT_H
+#define MPI_TRANSPORT_H
+
+#include "mpi.h"
+#include "philosopher.h"
+#include "topology.h"
+
+// One philosopher per rank of the topology's ring, two-sided point-to-point messages.
+struct MpiTransport : public Transport {
+    const Topology &topo;
+    MPI_Comm comm;
+    MPI_Request barrier;
+    bool finished;
+
+    MpiTransport(const Topology &_topo) : topo(_topo), comm(_topo.ring), finished(false) {}
+
+    void send(const ForkMessage &msg, int to){
+        MPI_Send((void *) &msg, sizeof(ForkMessage), MPI_BYTE, to, 0, comm);
+    }
+
+    bool poll(ForkMessage &msg){
+        int flag;
+        MPI_Iprobe(MPI_ANY_SOURCE, MPI_ANY_TAG, comm, &flag, MPI_STATUS_IGNORE);
+        if(flag)
+            MPI_Recv(&msg, sizeof(ForkMessage), MPI_BYTE, MPI_ANY_SOURCE, MPI_ANY_TAG, comm, MPI_STATUS_IGNORE);
+        return flag;
+    }
+
+    bool wait(ForkMessage &msg, double deadline){
+        if(deadline <= 0){
+            MPI_Recv(&msg, sizeof(ForkMessage), MPI_BYTE, MPI_ANY_SOURCE, MPI_ANY_TAG, comm, MPI_STATUS_IGNORE);
+            return true;
+        }
+
+        while(!poll(msg))
+            if(now() > deadline)
+                return false;
+        return true;
+    }
+
+    void finish(){
+        MPI_Ibarrier(comm, &barrier);
+        finished = true;
+    }
+
+    bool all_finished(){
+        int done = 0;
+        if(finished)
+            MPI_Test(&barrier, &done, MPI_STATUS_IGNORE);
+        return done;
+    }
+
+    bool remote(int to){
+        return !topo.same_node(topo.seat, to);
+    }
+};
+
+#endif
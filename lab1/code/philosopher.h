@@ -0,0 +1,403 @@
+#ifndef PHILOSOPHER_H
+#define PHILOSOPHER_H
+
+#include <cmath>
+#include <cstdlib>
+#include <cstdio>
+#include <ctime>
+#include <unistd.h>
+#include <vector>
+#include "event-log.h"
+
+using std::vector;
+
+struct Fork {
+    int id;
+    bool clean;
+    int owner;
+    int alt_owner;
+    int requester;          // neighbour waiting for this fork, -1 if none
+    long long requested_at; // arrival order of that request
+
+    Fork() {}
+    Fork(int _id, bool _clean, int _owner, int _alt_owner) :
+        id(_id), clean(_clean), owner(_owner), alt_owner(_alt_owner), requester(-1), requested_at(0) {}
+};
+
+struct ForkMessage{
+    int id;
+    int sender;
+    int type;
+
+    ForkMessage() {}
+    ForkMessage(int _id, int _sender, int _type) : id(_id), sender(_sender), type(_type) {}
+};
+
+#define FORK_REQUEST 0
+#define FORK_RESPONSE 1
+
+#define POLL_INTERVAL_MS 10
+#define LATENCY_BUCKETS 128     // bucket i covers [2^(i/4), 2^((i+1)/4)) us
+
+#define BACKEND_MPI 0
+#define BACKEND_THREADS 1
+#define BACKEND_SIM 2
+#define BACKEND_RMA 3
+
+struct BenchConfig {
+    bool enabled;       // benchmark mode: bounded run + final statistics
+    bool reorder;       // seat ranks of one node next to each other
+    bool verbose;       // keep the per-event output in benchmark mode
+    int meals;          // stop after this many meals (0 = no limit)
+    double duration;    // stop after this many seconds (0 = no limit)
+    unsigned seed;
+    int think_ms;       // mean thinking time
+    int eat_ms;         // mean eating time
+    bool exponential;   // exponential instead of uniform [0, 2 * mean)
+    int backend;
+    int philosophers;   // table size for the threads and sim backends
+    double latency_us;  // sim: minimum message latency
+    double jitter_us;   // sim: mean of the exponential extra latency
+    const char *log_prefix;     // binary event logs instead of text output
+
+    BenchConfig() : enabled(false), reorder(true), verbose(true), meals(0), duration(0), seed(1),
+        think_ms(2500), eat_ms(0), exponential(false), backend(BACKEND_MPI), philosophers(5),
+        latency_us(50), jitter_us(0), log_prefix(NULL) {}
+};
+
+struct Stats {
+    long long meals;
+    long long messages;
+    long long cross_node;       // messages to a philosopher on another node
+    double max_starvation;      // longest hungry period, in seconds
+    double elapsed;
+    long long latency[LATENCY_BUCKETS];     // hungry->eating, plus the waits of never-served hungry periods
+
+    Stats() : meals(0), messages(0), cross_node(0), max_starvation(0), elapsed(0) {
+        for(int i = 0; i < LATENCY_BUCKETS; ++i) latency[i] = 0;
+    }
+
+    void add_latency(double seconds){
+        double us = seconds * 1e6;
+        int bucket = us < 1 ? 0 : (int) (4 * log2(us));
+        latency[bucket < LATENCY_BUCKETS ? bucket : LATENCY_BUCKETS - 1]++;
+        add_starvation(seconds);
+    }
+
+    void add_starvation(double seconds){
+        if(seconds > max_starvation) max_starvation = seconds;
+    }
+
+    void merge(const Stats &other){
+        meals += other.meals;
+        messages += other.messages;
+        cross_node += other.cross_node;
+        if(other.max_starvation > max_starvation) max_starvation = other.max_starvation;
+        if(other.elapsed > elapsed) elapsed = other.elapsed;
+        for(int i = 0; i < LATENCY_BUCKETS; ++i) latency[i] += other.latency[i];
+    }
+};
+
+inline void _print_spaces(int i){
+    while(i--) putchar(' ');
+}
+
+#define MSG_PRINT(format, ...) \
+do{ \
+    printf("<process %d> :: " format "\n", k, ##__VA_ARGS__ ); \
+    fflush(stdout); \
+} while(0)
+
+#define STAT_PRINT(format, ...) \
+do{ \
+    _print_spaces(k); \
+    printf(format "\n", ##__VA_ARGS__ ); \
+    fflush(stdout); \
+} while(0)
+
+// Per-event output of a philosopher: into the binary event log when one is
+// open, otherwise as text in verbose mode.
+#define STAT_LOG(format, ...) \
+do{ \
+    if(event_log().active()) \
+        LOG_EVENT(LOG_STAT, k, format, ##__VA_ARGS__); \
+    else if(cfg.verbose) \
+        STAT_PRINT(format, ##__VA_ARGS__); \
+} while(0)
+
+#define DUMP_VECTOR(v) \
+do{ \
+    printf("<process %d forks> ::\n", k); \
+    for(vector<Fork>::const_iterator it = v.begin(); it != v.end(); ++it) \
+        printf("{%d, %c, (%d) <-> %d}, ", it->id, it->clean ? 'T' : 'F', it->owner, it->alt_owner); \
+    printf("\n"); \
+    fflush(stdout); \
+} while(0)
+
+inline double wall_time(){
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// How philosophers exchange fork messages; one instance per philosopher.
+struct Transport {
+    virtual ~Transport() {}
+
+    virtual void send(const ForkMessage &msg, int to) = 0;
+
+    // Returns the next message if one has already arrived.
+    virtual bool poll(ForkMessage &msg) = 0;
+
+    // Blocks for the next message; gives up and returns false once the deadline passes (0 = never).
+    virtual bool wait(ForkMessage &msg, double deadline) = 0;
+
+    // Returns the next message that arrives while thinking, or false once
+    // the deadline passes; always polls at least once. By default it sleeps
+    // POLL_INTERVAL_MS between polls, so requests wait up to that long.
+    virtual bool think_until(ForkMessage &msg, double deadline){
+        double now;
+        while(!poll(msg)){
+            if((now = this->now()) >= deadline)
+                return false;
+            double left_ms = (deadline - now) * 1000;
+            usleep((left_ms < POLL_INTERVAL_MS ? left_ms : POLL_INTERVAL_MS) * 1000);
+        }
+        return true;
+    }
+
+    // Announces that this philosopher will not eat anymore.
+    virtual void finish() = 0;
+
+    // True once every philosopher has called finish().
+    virtual bool all_finished() = 0;
+
+    virtual double now() { return wall_time(); }
+
+    // True if philosopher `to` runs on another node.
+    virtual bool remote(int to) { return false; }
+};
+
+// Returns the next think/eat period in milliseconds.
+inline int draw_time(const BenchConfig &cfg, unsigned &rng, int mean){
+    if(mean <= 0) return 0;
+    if(cfg.exponential)
+        return (int) (-mean * log(1.0 - rand_r(&rng) / (RAND_MAX + 1.0)));
+    return rand_r(&rng) % (2 * mean);
+}
+
+// The real-time think / hungry / eat cycle, until cfg.meals meals or
+// cfg.duration seconds. P supplies cfg, rng, stats, now(), think_until(time),
+// eat_by(deadline) (false if the deadline came first) and finish_eating().
+template<typename P>
+void run_meals(P &p){
+    const BenchConfig &cfg = p.cfg;
+    double start_time = p.now();
+    double deadline = cfg.duration > 0 ? start_time + cfg.duration : 0;
+
+    while(true){
+        double think_end = p.now() + draw_time(cfg, p.rng, cfg.think_ms) / 1000.0;
+        if(deadline > 0 && think_end > deadline) think_end = deadline;
+        p.think_until(think_end);
+
+        if(deadline > 0 && p.now() >= deadline)
+            break;
+
+        if(!p.eat_by(deadline))     // out of time while hungry
+            break;
+
+        int eat_time = draw_time(cfg, p.rng, cfg.eat_ms);
+        if(eat_time > 0) usleep(eat_time * 1000);
+
+        p.finish_eating();
+        if(p.stats.meals == cfg.meals)
+            break;
+    }
+
+    p.stats.elapsed = p.now() - start_time;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+enum PhilosopherState{
+    THINKING, HUNGRY, EATING, DONE
+};
+
+// The Chandy-Misra fork protocol for philosopher k at a table of N; the
+// handlers never block, so any transport (or a simulator) can drive them.
+struct Philosopher {
+    int k, N;
+    vector<Fork> forks;     // forks[0] has id k, forks[1] id (k + 1) % N
+    long long request_count;
+    Transport &transport;
+    const BenchConfig &cfg;
+    Stats stats;
+    PhilosopherState state;
+    int waiting_for;        // fork we asked for and are waiting on, -1 if none
+    double hungry_since;
+    unsigned rng;
+
+    Philosopher(int _k, int _N, Transport &_transport, const BenchConfig &_cfg) :
+        k(_k), N(_N), request_count(0), transport(_transport), cfg(_cfg), state(THINKING), waiting_for(-1),
+        hungry_since(0), rng(_cfg.seed + _k) {
+        if(k == 0){
+            forks.push_back(Fork(0, false, 0, 1));
+            forks.push_back(Fork(1, false, 0, 1));
+        } else if(k == N-1){
+            forks.push_back(Fork(N - 1, false, N - 2, N - 1));
+            forks.push_back(Fork(0, false, 0, N - 1));
+        } else {
+            forks.push_back(Fork(k, false, k - 1, k));
+            forks.push_back(Fork(k + 1, false, k, k + 1));
+        }
+    }
+
+    void send_message(ForkMessage msg, int to){
+        transport.send(msg, to);
+        stats.messages++;
+        if(transport.remote(to)) stats.cross_node++;
+    }
+
+    Fork &fork(int id){
+        return forks[forks[0].id == id ? 0 : 1];
+    }
+
+    void give(Fork &f, int to){
+        // MSG_PRINT("Passing the fork %d to %d.", f.id, to);
+        f.owner = to;
+        f.alt_owner = k;
+        f.clean = true;
+        f.requester = -1;
+        send_message(ForkMessage(f.id, k, FORK_RESPONSE), to);
+    }
+
+    void parse_request(ForkMessage msg){
+        // MSG_PRINT("Parsing a request: {%s, F=%d, S=%d}", msg.type ? "RES" : "REQ", msg.id, msg.sender);
+        Fork &f = fork(msg.id);
+        if(f.owner == k && state != EATING && (!f.clean || state == DONE)){
+            give(f, msg.sender);
+        } else { // clean, or I don't have it yet
+            f.requester = msg.sender;
+            f.requested_at = ++request_count;
+        }
+    }
+
+    void parse_response(ForkMessage msg){
+        // MSG_PRINT("Parsing a response: {%s, F=%d, S=%d}", msg.type ? "RES" : "REQ", msg.id, msg.sender);
+        Fork &f = fork(msg.id);
+        f.clean = true;
+        f.owner = k;
+        f.alt_owner = msg.sender;
+        if(msg.id == waiting_for)
+            waiting_for = -1;
+        // MSG_PRINT("Got a fork %d from %d.", msg.id, msg.sender);
+    }
+
+    void receive(ForkMessage msg){
+        if(msg.type == FORK_RESPONSE)
+            parse_response(msg);
+        else
+            parse_request(msg);
+
+        if(state == HUNGRY)
+            request_missing();
+        else if(state == DONE)
+            hand_over();
+    }
+
+    // Asks for the first fork we are missing, one request at a time; starts
+    // eating once both are here.
+    void request_missing(){
+        if(waiting_for != -1)
+            return;
+        for(int i = 0; i < 2; ++i)
+            if(forks[i].owner != k){
+                // MSG_PRINT("I don't have a fork %d! -> Asking %d for it.", forks[i].id, forks[i].owner);
+                STAT_LOG("trazim vilicu (%d)", forks[i].id);
+                waiting_for = forks[i].id;
+                send_message(ForkMessage(forks[i].id, k, FORK_REQUEST), forks[i].owner);
+                return;
+            }
+
+        //MSG_PRINT("I have all the forks, EATING!");
+        state = EATING;
+        stats.add_latency(transport.now() - hungry_since);
+        STAT_LOG("jedem");
+    }
+
+    void start_thinking(){
+        state = THINKING;
+        // MSG_PRINT("Going to think!");
+        STAT_LOG("mislim");
+    }
+
+    void start_hungry(){
+        state = HUNGRY;
+        hungry_since = transport.now();
+        request_missing();
+    }
+
+    void finish_eating(){
+        for(int i = 0; i < 2; ++i)
+            forks[i].clean = false;
+        hand_over();
+        stats.meals++;
+    }
+
+    // Passes every owned fork that somebody asked for to its requester,
+    // in the order the requests arrived.
+    void hand_over(){
+        int first = forks[1].requested_at < forks[0].requested_at ? 1 : 0;
+        for(int i = first; i < first + 2; ++i){
+            Fork &f = forks[i % 2];
+            if(f.requester != -1 && f.owner == k)
+                give(f, f.requester);
+        }
+    }
+
+    // Stops eating for good; whoever is still hungry gets our forks from now on.
+    void leave(){
+        if(state == HUNGRY)
+            stats.add_latency(transport.now() - hungry_since);
+        state = DONE;
+        hand_over();
+        transport.finish();
+    }
+
+    double now(){
+        return transport.now();
+    }
+
+    void think_until(double time){
+        ForkMessage incoming;
+        start_thinking();
+        // even without thinking time, answers the neighbours before eating again
+        while(transport.think_until(incoming, time))
+            receive(incoming);
+    }
+
+    bool eat_by(double deadline){
+        ForkMessage incoming;
+        start_hungry();
+        while(state == HUNGRY && transport.wait(incoming, deadline))
+            receive(incoming);
+        return state == EATING;
+    }
+
+    // Main loop for transports with real time; runs until the configured
+    // number of meals or the deadline, then keeps giving forks away until
+    // everybody is done.
+    void run(){
+        ForkMessage incoming;
+        run_meals(*this);
+
+        leave();
+        while(!transport.all_finished())
+            if(transport.wait(incoming, transport.now() + POLL_INTERVAL_MS / 1000.0))
+                receive(incoming);
+    }
+};
+
+#endif
@@ -0,0 +1,225 @@
+#ifndef RMA_PHILOSOPHER_H
+#define RMA_PHILOSOPHER_H
+
+#include "mpi.h"
+#include <sched.h>
+#include "philosopher.h"
+#include "topology.h"
+
+// Every fork is one int in an MPI window, fork f living in rank f % N at
+// displacement f / N: the owner's id shifted left by two, plus the flags
+// below. Everything goes through MPI_Compare_and_swap / MPI_Fetch_and_op
+// under a passive-target lock_all epoch, so nobody has to service requests:
+//  - a dirty fork (not HELD) is simply taken by a hungry neighbour with a CAS,
+//  - a clean or in-use fork (HELD) gets the REQUESTED flag, and its owner
+//    passes it over itself after eating.
+// That is the Chandy-Misra rule with "clean" and "being eaten with" folded
+// into HELD.
+//
+// Forks whose two philosophers share a node live in an MPI_Win_allocate_shared
+// segment instead and are handled with plain atomics on that memory; only
+// forks between nodes go through the MPI window.
+
+#define RMA_HELD 1
+#define RMA_REQUESTED 2
+#define RMA_WORD(owner, flags) ((owner) << 2 | (flags))
+#define RMA_OWNER(w) ((w) >> 2)
+
+struct RmaPhilosopher {
+    int k, N;
+    int fork_ids[2];
+    int neighbours[2];      // the other philosopher sharing each fork
+    const BenchConfig &cfg;
+    Stats stats;
+    PhilosopherState state;
+    double hungry_since;
+    bool asked[2];          // printed the request for this fork already
+    unsigned rng;
+    const Topology &topo;
+    MPI_Win win;            // forks between nodes
+    MPI_Win shared_win;     // forks within a node
+    int *base, *shared_base;
+    int *words[2];          // fork i in shared memory, NULL if it lives in win
+
+    RmaPhilosopher(const Topology &_topo, const BenchConfig &_cfg) :
+        k(_topo.seat), N(_topo.node_of.size()), cfg(_cfg), state(THINKING), hungry_since(0),
+        rng(_cfg.seed + _topo.seat), topo(_topo) {
+        fork_ids[0] = k;
+        fork_ids[1] = N == 1 ? 1 : (k + 1) % N;
+        neighbours[0] = (k + N - 1) % N;
+        neighbours[1] = (k + 1) % N;
+
+        MPI_Win_allocate(2 * sizeof(int), sizeof(int), MPI_INFO_NULL, topo.ring, &base, &win);
+        MPI_Win_allocate_shared(2 * sizeof(int), sizeof(int), MPI_INFO_NULL, topo.node, &shared_base, &shared_win);
+        MPI_Win_lock_all(MPI_MODE_NOCHECK, win);
+        MPI_Win_lock_all(MPI_MODE_NOCHECK, shared_win);
+
+        for(int i = 0; i < 2; ++i){
+            int f = fork_ids[i];
+            words[i] = NULL;
+            if(on_node(f)){
+                MPI_Aint size;
+                int disp_unit;
+                int *host_base;
+                MPI_Win_shared_query(shared_win, topo.node_rank(f % N), &size, &disp_unit, &host_base);
+                words[i] = host_base + f / N;
+            }
+        }
+
+        // same initial (acyclic) ownership as the message-passing version
+        for(int f = k; f < (N == 1 ? 2 : N); f += N){
+            int owner = f == 0 ? 0 : (f == N - 1 ? N - 2 : f - 1), old;
+            int word = RMA_WORD(owner, 0);
+            if(on_node(f))
+                __atomic_store_n(shared_base + f / N, word, __ATOMIC_SEQ_CST);
+            else
+                MPI_Fetch_and_op(&word, &old, MPI_INT, k, f / N, MPI_REPLACE, win);
+        }
+        MPI_Win_flush(k, win);
+        MPI_Win_sync(shared_win);
+        MPI_Barrier(topo.ring);
+        MPI_Win_sync(shared_win);
+    }
+
+    ~RmaPhilosopher(){
+        MPI_Win_unlock_all(shared_win);
+        MPI_Win_unlock_all(win);
+        MPI_Win_free(&shared_win);
+        MPI_Win_free(&win);
+    }
+
+    // Both philosophers using fork f sit on the same node.
+    bool on_node(int f){
+        return topo.same_node((f + N - 1) % N, f % N);
+    }
+
+    void count(int f){
+        if(f % N != k) stats.messages++;
+        if(!topo.same_node(k, f % N)) stats.cross_node++;
+    }
+
+    int read(int i){
+        if(words[i])
+            return __atomic_load_n(words[i], __ATOMIC_SEQ_CST);
+
+        int f = fork_ids[i], result;
+        MPI_Fetch_and_op(NULL, &result, MPI_INT, f % N, f / N, MPI_NO_OP, win);
+        MPI_Win_flush(f % N, win);
+        count(f);
+        return result;
+    }
+
+    // Replaces the word of fork i if it still equals expected; seen gets the old value.
+    bool cas(int i, int expected, int desired, int &seen){
+        if(words[i]){
+            seen = expected;
+            return __atomic_compare_exchange_n(words[i], &seen, desired, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+        }
+
+        int f = fork_ids[i];
+        MPI_Compare_and_swap(&desired, &expected, &seen, MPI_INT, f % N, f / N, win);
+        MPI_Win_flush(f % N, win);
+        count(f);
+        return seen == expected;
+    }
+
+    // Drops the claim on a fork we own: back to dirty, or straight to the
+    // neighbour if it asked for it meanwhile.
+    void release(int i){
+        int w = read(i);
+        while(RMA_OWNER(w) == k && (w & (RMA_HELD | RMA_REQUESTED))){
+            int desired = w & RMA_REQUESTED ? RMA_WORD(neighbours[i], RMA_HELD) : RMA_WORD(k, 0);
+            if(cas(i, w, desired, w))
+                break;
+        }
+    }
+
+    // One pass of the hungry state; true once both forks are ours and held.
+    bool try_eat(){
+        bool have_all = true;
+        for(int i = 0; i < 2; ++i){
+            int w = read(i);
+            if(RMA_OWNER(w) == k)
+                continue;
+
+            if(!asked[i]){
+                asked[i] = true;
+                STAT_LOG("trazim vilicu (%d)", fork_ids[i]);
+            }
+            if(!(w & RMA_HELD) && cas(i, w, RMA_WORD(k, RMA_HELD), w))
+                continue;       // took a dirty fork
+            if((w & RMA_HELD) && !(w & RMA_REQUESTED))
+                cas(i, w, w | RMA_REQUESTED, w);
+            have_all = false;
+        }
+        if(!have_all)
+            return false;
+
+        // both are ours, claim the dirty ones before someone takes them
+        bool claimed[2] = {false, false};
+        for(int i = 0; i < 2; ++i){
+            int w = read(i);
+            bool ok = RMA_OWNER(w) == k && ((w & RMA_HELD) || cas(i, w, w | RMA_HELD, w));
+            if(!ok){
+                for(int j = 0; j < i; ++j)
+                    if(claimed[j]) release(j);
+                return false;
+            }
+            claimed[i] = !(w & RMA_HELD);
+        }
+        return true;
+    }
+
+    double now(){
+        return wall_time();
+    }
+
+    void think_until(double time){
+        state = THINKING;
+        STAT_LOG("mislim");
+        double left = time - wall_time();
+        if(left > 0) usleep(left * 1e6);
+    }
+
+    bool eat_by(double deadline){
+        state = HUNGRY;
+        hungry_since = wall_time();
+        asked[0] = asked[1] = false;
+        while(!try_eat()){
+            if(deadline > 0 && wall_time() > deadline){
+                stats.add_latency(wall_time() - hungry_since);
+                return false;
+            }
+            sched_yield();      // let the fork owners on this core run
+        }
+
+        state = EATING;
+        stats.add_latency(wall_time() - hungry_since);
+        STAT_LOG("jedem");
+        return true;
+    }
+
+    void finish_eating(){
+        for(int i = 0; i < 2; ++i)
+            release(i);
+        stats.meals++;
+    }
+
+    void run(){
+        run_meals(*this);
+
+        // forks may still be handed to us; keep letting them go until everybody is done
+        state = DONE;
+        MPI_Request barrier;
+        MPI_Ibarrier(topo.ring, &barrier);
+        int done = 0;
+        while(!done){
+            for(int i = 0; i < 2; ++i)
+                release(i);
+            MPI_Test(&barrier, &done, MPI_STATUS_IGNORE);
+            if(!done) sched_yield();
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,245 @@
+#ifndef SIMULATION_H
+#define SIMULATION_H
+
+#include "mpi.h"
+#include <algorithm>
+#include <functional>
+#include <limits>
+#include <map>
+#include <queue>
+#include "philosopher.h"
+
+using std::map;
+using std::priority_queue;
+
+#define SIM_MESSAGE 0
+#define SIM_THINK_DONE 1
+#define SIM_EAT_DONE 2
+
+// Simultaneous events are common (whole-millisecond periods, fixed latency),
+// so ties are broken by (target, type, sender, seq) -- a key that does not
+// depend on how the table is split over the ranks, which keeps sharded runs
+// identical to a single-rank one.
+struct SimEvent {
+    double time;
+    int type;
+    int target;
+    int sender;         // the target itself for timers
+    long long seq;      // messages sent so far by the sender; keeps a channel FIFO on ties
+    ForkMessage msg;
+
+    SimEvent() {}
+    SimEvent(double _time, int _type, int _target, int _sender, long long _seq, ForkMessage _msg) :
+        time(_time), type(_type), target(_target), sender(_sender), seq(_seq), msg(_msg) {}
+
+    bool operator>(const SimEvent &other) const {
+        if(time != other.time) return time > other.time;
+        if(target != other.target) return target > other.target;
+        if(type != other.type) return type > other.type;
+        if(sender != other.sender) return sender > other.sender;
+        return seq > other.seq;
+    }
+};
+
+struct Simulation;
+
+// Hands messages to the simulator instead of a network; time is virtual.
+struct SimTransport : public Transport {
+    Simulation &sim;
+    int k;
+
+    SimTransport(Simulation &_sim, int _k) : sim(_sim), k(_k) {}
+
+    void send(const ForkMessage &msg, int to);
+    bool poll(ForkMessage &msg) { return false; }
+    bool wait(ForkMessage &msg, double deadline) { return false; }
+    void finish() {}
+    bool all_finished() { return true; }
+    double now();
+};
+
+// Discrete-event simulation of a table of cfg.philosophers, split into
+// contiguous blocks over the ranks of comm. Ranks advance in
+// windows as long as the minimum message latency (the lookahead), so no
+// message from another rank can arrive in the past; between windows they
+// exchange the messages that crossed block boundaries.
+struct Simulation {
+    const BenchConfig &cfg;
+    MPI_Comm comm;
+    int N, rank, size, first;
+    vector<int> firsts;                 // first philosopher of every rank, plus N
+    vector<SimTransport *> transports;
+    vector<Philosopher *> philosophers;
+    priority_queue<SimEvent, vector<SimEvent>, std::greater<SimEvent> > events;
+    map<long long, double> channels;    // last delivery time per (from, to), keeps channels FIFO
+    vector<vector<SimEvent> > outbox;   // per rank
+    vector<long long> sent;             // per local philosopher, numbers its messages
+    vector<unsigned> rngs;              // per local philosopher, draws its messages' jitter
+    double clock;
+
+    Simulation(const BenchConfig &_cfg, MPI_Comm _comm) :
+        cfg(_cfg), comm(_comm), N(_cfg.philosophers), clock(0) {
+        MPI_Comm_rank(comm, &rank);
+        MPI_Comm_size(comm, &size);
+
+        for(int r = 0; r <= size; ++r)
+            firsts.push_back((long long) N * r / size);
+        first = firsts[rank];
+        outbox.resize(size);
+
+        for(int k = first; k < firsts[rank + 1]; ++k){
+            transports.push_back(new SimTransport(*this, k));
+            philosophers.push_back(new Philosopher(k, N, *transports.back(), cfg));
+            sent.push_back(0);
+            rngs.push_back(cfg.seed * 7919 + k);
+        }
+    }
+
+    ~Simulation(){
+        for(size_t i = 0; i < philosophers.size(); ++i){
+            delete philosophers[i];
+            delete transports[i];
+        }
+    }
+
+    int owner_of(int k){
+        return std::upper_bound(firsts.begin(), firsts.end(), k) - firsts.begin() - 1;
+    }
+
+    void schedule(const SimEvent &e){
+        events.push(e);
+    }
+
+    void deliver(int from, int to, const ForkMessage &msg){
+        double time = clock + cfg.latency_us * 1e-6;
+        if(cfg.jitter_us > 0)
+            time -= cfg.jitter_us * 1e-6 * log(1.0 - rand_r(&rngs[from - first]) / (RAND_MAX + 1.0));
+
+        double &last = channels[(long long) from * N + to];
+        if(time < last) time = last;
+        last = time;
+
+        SimEvent e(time, SIM_MESSAGE, to, from, sent[from - first]++, msg);
+        int owner = owner_of(to);
+        if(owner == rank)
+            schedule(e);
+        else
+            outbox[owner].push_back(e);
+    }
+
+    void think(Philosopher &p){
+        p.start_thinking();
+        schedule(SimEvent(clock + draw_time(cfg, p.rng, cfg.think_ms) / 1000.0, SIM_THINK_DONE, p.k, p.k, 0, ForkMessage()));
+    }
+
+    void eat(Philosopher &p){
+        schedule(SimEvent(clock + draw_time(cfg, p.rng, cfg.eat_ms) / 1000.0, SIM_EAT_DONE, p.k, p.k, 0, ForkMessage()));
+    }
+
+    void step(const SimEvent &e){
+        Philosopher &p = *philosophers[e.target - first];
+        clock = e.time;
+
+        switch(e.type){
+            case SIM_THINK_DONE:
+                p.start_hungry();
+                if(p.state == EATING) eat(p);
+                break;
+            case SIM_MESSAGE: {
+                PhilosopherState before = p.state;
+                p.receive(e.msg);
+                if(before == HUNGRY && p.state == EATING) eat(p);
+                break;
+            }
+            case SIM_EAT_DONE:
+                p.finish_eating();
+                if(p.stats.meals == cfg.meals)
+                    p.leave();
+                else
+                    think(p);
+                break;
+        }
+    }
+
+    // Swaps the messages that crossed to other ranks during the last window.
+    void exchange(){
+        vector<int> send_counts(size), recv_counts(size), send_displs(size), recv_displs(size);
+        vector<SimEvent> sendbuf;
+        for(int r = 0; r < size; ++r){
+            send_displs[r] = sendbuf.size() * sizeof(SimEvent);
+            send_counts[r] = outbox[r].size() * sizeof(SimEvent);
+            sendbuf.insert(sendbuf.end(), outbox[r].begin(), outbox[r].end());
+            outbox[r].clear();
+        }
+
+        MPI_Alltoall(&send_counts[0], 1, MPI_INT, &recv_counts[0], 1, MPI_INT, comm);
+        int total = 0;
+        for(int r = 0; r < size; ++r){
+            recv_displs[r] = total;
+            total += recv_counts[r];
+        }
+
+        vector<SimEvent> recvbuf(total / sizeof(SimEvent) + 1);
+        sendbuf.resize(sendbuf.size() + 1);
+        MPI_Alltoallv(&sendbuf[0], &send_counts[0], &send_displs[0], MPI_BYTE,
+                      &recvbuf[0], &recv_counts[0], &recv_displs[0], MPI_BYTE, comm);
+
+        for(size_t i = 0; i < total / sizeof(SimEvent); ++i)
+            schedule(recvbuf[i]);
+    }
+
+    // Runs until the virtual deadline, or until everybody had cfg.meals meals
+    // and all messages are delivered.
+    void run(){
+        const double never = std::numeric_limits<double>::infinity();
+        double deadline = cfg.duration > 0 ? cfg.duration : never;
+        double lookahead = size > 1 ? cfg.latency_us * 1e-6 : never;
+
+        for(size_t i = 0; i < philosophers.size(); ++i)
+            think(*philosophers[i]);
+
+        while(true){
+            double next = events.empty() ? never : events.top().time, global;
+            MPI_Allreduce(&next, &global, 1, MPI_DOUBLE, MPI_MIN, comm);
+            if(global == never || global > deadline)
+                break;
+
+            double window_end = global + lookahead;
+            while(!events.empty() && events.top().time < window_end && events.top().time <= deadline){
+                SimEvent e = events.top(); events.pop();
+                step(e);
+            }
+
+            if(size > 1)
+                exchange();
+        }
+
+        if(deadline != never)
+            clock = deadline;
+        else
+            MPI_Allreduce(MPI_IN_PLACE, &clock, 1, MPI_DOUBLE, MPI_MAX, comm);
+        for(size_t i = 0; i < philosophers.size(); ++i){
+            Philosopher &p = *philosophers[i];
+            if(p.state == HUNGRY)
+                p.stats.add_latency(clock - p.hungry_since);
+            p.stats.elapsed = clock;
+        }
+    }
+
+    vector<Stats> stats(){
+        vector<Stats> result;
+        for(size_t i = 0; i < philosophers.size(); ++i)
+            result.push_back(philosophers[i]->stats);
+        return result;
+    }
+};
+
+inline void SimTransport::send(const ForkMessage &msg, int to){
+    sim.deliver(k, to, msg);
+}
+
+inline double SimTransport::now(){
+    return sim.clock;
+}
+
+#endif
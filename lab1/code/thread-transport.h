@@ -0,0 +1,176 @@
+#ifndef THREAD_TRANSPORT_H
+#define THREAD_TRANSPORT_H
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <pthread.h>
+#include <sched.h>
+#include "philosopher.h"
+
+#define MAILBOX_SIZE 64         // power of two; a philosopher never has more than a few messages queued
+#define MAILBOX_SPINS 200       // polls before a waiting philosopher parks
+#define THREAD_STACK_SIZE (256 * 1024)
+
+// Bounded lock-free multi-producer single-consumer queue of fork messages.
+// Every cell carries a sequence number telling whether it is free for the
+// producer holding ticket pos (seq == pos) or readable by the consumer
+// (seq == pos + 1).
+struct Mailbox {
+    struct Cell {
+        std::atomic<size_t> seq;
+        ForkMessage msg;
+    };
+
+    Cell cells[MAILBOX_SIZE];
+    alignas(64) std::atomic<size_t> head;       // next ticket for producers
+    alignas(64) size_t tail;                    // owned by the consumer
+    std::atomic<bool> parked;
+    std::mutex lock;
+    std::condition_variable wakeup;
+
+    Mailbox() : head(0), tail(0), parked(false) {
+        for(size_t i = 0; i < MAILBOX_SIZE; ++i)
+            cells[i].seq.store(i, std::memory_order_relaxed);
+    }
+
+    void push(const ForkMessage &msg){
+        size_t pos = head.load(std::memory_order_relaxed);
+        Cell *cell;
+        while(true){
+            cell = &cells[pos & (MAILBOX_SIZE - 1)];
+            intptr_t diff = (intptr_t) cell->seq.load(std::memory_order_acquire) - (intptr_t) pos;
+            if(diff == 0){
+                if(head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            } else if(diff < 0){    // full, wait for the consumer
+                sched_yield();
+                pos = head.load(std::memory_order_relaxed);
+            } else {
+                pos = head.load(std::memory_order_relaxed);
+            }
+        }
+        cell->msg = msg;
+        cell->seq.store(pos + 1, std::memory_order_release);
+
+        // pairs with the fence in wait(): either the consumer sees the message
+        // or we see it parked
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if(parked.load(std::memory_order_relaxed)){
+            std::lock_guard<std::mutex> guard(lock);
+            wakeup.notify_one();
+        }
+    }
+
+    bool pop(ForkMessage &msg){
+        Cell *cell = &cells[tail & (MAILBOX_SIZE - 1)];
+        if(cell->seq.load(std::memory_order_acquire) != tail + 1)
+            return false;
+        msg = cell->msg;
+        cell->seq.store(tail + MAILBOX_SIZE, std::memory_order_release);
+        ++tail;
+        return true;
+    }
+
+    // Spins for a while, then parks until a producer wakes us up or the
+    // deadline (0 = never) passes.
+    bool wait(ForkMessage &msg, double deadline){
+        for(int i = 0; i < MAILBOX_SPINS; ++i)
+            if(pop(msg))
+                return true;
+
+        std::unique_lock<std::mutex> guard(lock);
+        parked.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        bool got;
+        while(!(got = pop(msg))){
+            double left = deadline > 0 ? deadline - wall_time() : POLL_INTERVAL_MS / 1000.0;
+            if(left <= 0)
+                break;
+            wakeup.wait_for(guard, std::chrono::microseconds((long long) (left * 1e6) + 1));
+        }
+        parked.store(false, std::memory_order_relaxed);
+        return got;
+    }
+};
+
+// Shared state of a table whose philosophers are threads of one process.
+struct ThreadTable {
+    vector<Mailbox> mailboxes;
+    std::atomic<int> finished;
+
+    ThreadTable(int N) : mailboxes(N), finished(0) {}
+};
+
+struct ThreadTransport : public Transport {
+    ThreadTable &table;
+    int k;
+
+    ThreadTransport(ThreadTable &_table, int _k) : table(_table), k(_k) {}
+
+    void send(const ForkMessage &msg, int to){
+        table.mailboxes[to].push(msg);
+    }
+
+    bool poll(ForkMessage &msg){
+        return table.mailboxes[k].pop(msg);
+    }
+
+    bool wait(ForkMessage &msg, double deadline){
+        return table.mailboxes[k].wait(msg, deadline);
+    }
+
+    // Parks on the mailbox instead of sleeping, so a request wakes us at once.
+    bool think_until(ForkMessage &msg, double deadline){
+        return table.mailboxes[k].wait(msg, deadline);
+    }
+
+    void finish(){
+        table.finished.fetch_add(1);
+    }
+
+    bool all_finished(){
+        return table.finished.load() == (int) table.mailboxes.size();
+    }
+};
+
+inline void *_run_philosopher(void *philosopher){
+    ((Philosopher *) philosopher)->run();
+    return NULL;
+}
+
+// Runs a table of cfg.philosophers threads in this process and returns
+// their statistics, indexed by philosopher.
+inline vector<Stats> run_threads(const BenchConfig &cfg){
+    int N = cfg.philosophers;
+    ThreadTable table(N);
+    vector<ThreadTransport *> transports;
+    vector<Philosopher *> philosophers;
+    vector<pthread_t> threads(N);
+
+    for(int k = 0; k < N; ++k){
+        transports.push_back(new ThreadTransport(table, k));
+        philosophers.push_back(new Philosopher(k, N, *transports[k], cfg));
+    }
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, THREAD_STACK_SIZE);
+    for(int k = 0; k < N; ++k)
+        if(pthread_create(&threads[k], &attr, _run_philosopher, philosophers[k]) != 0){
+            fprintf(stderr, "cannot start philosopher %d\n", k);
+            abort();
+        }
+    pthread_attr_destroy(&attr);
+
+    vector<Stats> stats(N);
+    for(int k = 0; k < N; ++k){
+        pthread_join(threads[k], NULL);
+        stats[k] = philosophers[k]->stats;
+        delete philosophers[k];
+        delete transports[k];
+    }
+    return stats;
+}
+
+#endif
@@ -0,0 +1,81 @@
+#ifndef TOPOLOGY_H
+#define TOPOLOGY_H
+
+#include "mpi.h"
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+using std::vector;
+
+// Where the ranks sit. Ranks sharing memory (MPI_COMM_TYPE_SHARED) get
+// consecutive seats at the table, so a ring only leaves a node once per node
+// instead of at every rank a round-robin placement puts elsewhere. `ring` is
+// MPI_COMM_WORLD renumbered so that rank == seat; `node` holds the ranks of
+// this node, in seat order.
+struct Topology {
+    MPI_Comm ring;
+    MPI_Comm node;
+    int seat;
+    int nodes;
+    vector<int> node_of;        // node index of every seat
+
+    Topology(bool reorder){
+        int rank, size;
+        MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+        MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+        // name every node after its lowest world rank
+        MPI_Comm local;
+        int leader = rank;
+        MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, rank, MPI_INFO_NULL, &local);
+        MPI_Bcast(&leader, 1, MPI_INT, 0, local);
+        MPI_Comm_free(&local);
+
+        vector<int> leaders(size);
+        MPI_Allgather(&leader, 1, MPI_INT, &leaders[0], 1, MPI_INT, MPI_COMM_WORLD);
+
+        vector<int> distinct(leaders);
+        std::sort(distinct.begin(), distinct.end());
+        distinct.erase(std::unique(distinct.begin(), distinct.end()), distinct.end());
+        nodes = distinct.size();
+
+        vector<std::pair<int, int> > order;     // (node leader, world rank)
+        for(int r = 0; r < size; ++r)
+            order.push_back(std::make_pair(reorder ? leaders[r] : 0, r));
+        std::sort(order.begin(), order.end());
+
+        node_of.resize(size);
+        for(int s = 0; s < size; ++s){
+            int r = order[s].second;
+            if(r == rank) seat = s;
+            node_of[s] = std::lower_bound(distinct.begin(), distinct.end(), leaders[r]) - distinct.begin();
+        }
+
+        MPI_Comm_split(MPI_COMM_WORLD, 0, seat, &ring);
+        MPI_Comm_split_type(ring, MPI_COMM_TYPE_SHARED, seat, MPI_INFO_NULL, &node);
+    }
+
+    ~Topology(){
+        MPI_Comm_free(&node);
+        MPI_Comm_free(&ring);
+    }
+
+    bool same_node(int a, int b) const {
+        return node_of[a] == node_of[b];
+    }
+
+    // Rank of the given seat within `node`; it has to be on this node.
+    int node_rank(int s) const {
+        MPI_Group ring_group, node_group;
+        int result;
+        MPI_Comm_group(ring, &ring_group);
+        MPI_Comm_group(node, &node_group);
+        MPI_Group_translate_ranks(ring_group, 1, &s, node_group, &result);
+        MPI_Group_free(&ring_group);
+        MPI_Group_free(&node_group);
+        return result;
+    }
+};
+
+#endif
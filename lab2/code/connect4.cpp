@@ -1,5 +1,6 @@
 #include "mpi.h"
 #include <cstdio>
+#include <cstdlib>
 #include <cstring>
 #include <deque>
 #include <exception>
@@ -7,6 +8,7 @@
 #include <time.h>
 #include <unistd.h>
 #include <vector>
+#include "event-log.h"
 
 ////////////////////////////////////////////////////////////////////////////////
 
@@ -22,10 +24,16 @@
 
 ////////////////////////////////////////////////////////////////////////////////
 
+// With EVENT_LOG=<prefix> set, messages go to binary logs <prefix>.<rank>
+// (read them with log-merge) instead of stdout.
 #define MSG_PRINT(format, ...) \
 do{ \
-    printf("<process %d> :: " format "\n", k, ##__VA_ARGS__ ); \
-    fflush(stdout); \
+    if(event_log().active()) \
+        LOG_EVENT(LOG_MSG, k, format, ##__VA_ARGS__); \
+    else { \
+        printf("<process %d> :: " format "\n", k, ##__VA_ARGS__ ); \
+        fflush(stdout); \
+    } \
 } while(0)
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -609,13 +617,30 @@ int main(int argc, char* argv[]){
     MPI_Comm_rank(MPI_COMM_WORLD, &k);
     MPI_Get_processor_name(processor_name, &name_len);
 
-    MSG_PRINT("Started at %s", processor_name);
+    if(getenv("EVENT_LOG") && !event_log().open(getenv("EVENT_LOG"), k)){
+        perror(getenv("EVENT_LOG"));
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+
+    if(event_log().active()){
+        // the log only holds ints: name the node after its lowest rank instead
+        MPI_Comm local;
+        int node = k;
+        MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, k, MPI_INFO_NULL, &local);
+        MPI_Bcast(&node, 1, MPI_INT, 0, local);
+        MPI_Comm_free(&local);
+        MSG_PRINT("Started at the node of process %d", node);
+    } else {
+        printf("<process %d> :: Started at %s\n", k, processor_name);
+        fflush(stdout);
+    }
 
     if(k == 0)
         master(N);
     else
         worker(k);
 
+    event_log().close();
     MPI_Finalize();
     return 0;
 }
\ No newline at end of file
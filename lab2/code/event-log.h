@@ -0,0 +1,220 @@
+#ifndef EVENT_LOG_H
+#define EVENT_LOG_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <unistd.h>
+#include <vector>
+
+// Binary event log: every event is a fixed-size record (timestamp, format
+// code, who, up to LOG_MAX_ARGS int arguments) pushed into an in-memory ring
+// and written out by a background thread, so logging costs a few atomic
+// operations instead of a printf + fflush. Format strings are stored once per
+// file and applied offline by log-merge, which also merges files by time.
+//
+// File layout: LOG_MAGIC, then chunks of {uint32 kind, uint32 size, payload};
+// a formats chunk holds {int32 code, int32 style, NUL-terminated format}
+// entries, an events chunk holds LogRecords.
+
+#define LOG_MAGIC "EVLOG01"         // 8 bytes with the NUL
+#define LOG_MAX_ARGS 4
+#define LOG_RING_SIZE (1 << 16)     // records, power of two
+#define LOG_FLUSH_MS 20
+
+#define LOG_CHUNK_FORMATS 1
+#define LOG_CHUNK_EVENTS 2
+
+#define LOG_STAT 0      // rendered indented by `who` spaces
+#define LOG_MSG 1       // rendered as "<process who> :: ..."
+
+struct LogRecord {
+    int64_t time_ns;
+    int32_t code;
+    int32_t who;
+    int32_t args[LOG_MAX_ARGS];
+};
+
+// True if every type fits an int32 argument unchanged: integers and enums
+// up to 32 bits. Anything else (strings, doubles, long long) would be
+// handed to its %s / %f / %lld as an int by log-merge.
+template<typename... Args> struct _log_args_ok { static const bool value = true; };
+template<typename T, typename... Rest> struct _log_args_ok<T, Rest...> {
+    static const bool value = (std::is_integral<T>::value || std::is_enum<T>::value) &&
+        sizeof(T) <= sizeof(int32_t) && _log_args_ok<Rest...>::value;
+};
+
+struct EventLog {
+    struct Cell {
+        std::atomic<size_t> seq;
+        LogRecord record;
+    };
+
+    Cell *cells;
+    std::atomic<size_t> head;           // next ticket for producers
+    size_t tail;                        // owned by the flusher
+    std::atomic<long long> dropped;     // records lost because the ring was full
+
+    std::mutex formats_lock;
+    std::vector<std::string> formats;
+    std::vector<int> styles;
+    size_t formats_written;
+
+    FILE *file;
+    std::thread flusher;
+    std::atomic<bool> stopping;
+    const double *virtual_clock;        // if set, timestamps come from here (seconds)
+
+    EventLog() : cells(NULL), head(0), tail(0), dropped(0), formats_written(0), file(NULL),
+        stopping(false), virtual_clock(NULL) {}
+
+    ~EventLog(){
+        close();
+    }
+
+    bool active() const {
+        return file != NULL;
+    }
+
+    // Starts logging to "<prefix>.<rank>"; returns false if the file cannot be created.
+    bool open(const char *prefix, int rank){
+        char path[256];
+        snprintf(path, sizeof(path), "%s.%d", prefix, rank);
+        if((file = fopen(path, "wb")) == NULL)
+            return false;
+        fwrite(LOG_MAGIC, 1, 8, file);
+
+        cells = new Cell[LOG_RING_SIZE];
+        for(size_t i = 0; i < LOG_RING_SIZE; ++i)
+            cells[i].seq.store(i, std::memory_order_relaxed);
+
+        flusher = std::thread(&EventLog::flush_loop, this);
+        return true;
+    }
+
+    void close(){
+        if(!active())
+            return;
+        stopping.store(true);
+        flusher.join();
+        flush();
+
+        long long lost = dropped.load();
+        if(lost > 0)
+            fprintf(stderr, "event log: %lld events dropped, ring full\n", lost);
+
+        fclose(file);
+        file = NULL;
+        delete[] cells;
+        cells = NULL;
+    }
+
+    int register_format(int style, const char *format){
+        std::lock_guard<std::mutex> guard(formats_lock);
+        formats.push_back(format);
+        styles.push_back(style);
+        return formats.size() - 1;
+    }
+
+    int64_t now_ns(){
+        if(virtual_clock)
+            return (int64_t) (*virtual_clock * 1e9);
+        timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+    }
+
+    template<typename... Args>
+    void write(int code, int who, Args... args){
+        static_assert(sizeof...(Args) <= LOG_MAX_ARGS, "too many event arguments");
+        static_assert(_log_args_ok<Args...>::value, "event arguments have to be ints (or narrower integers / enums)");
+        int32_t values[] = {0, (int32_t) args...};
+
+        size_t pos = head.load(std::memory_order_relaxed);
+        Cell *cell;
+        while(true){
+            cell = &cells[pos & (LOG_RING_SIZE - 1)];
+            intptr_t diff = (intptr_t) cell->seq.load(std::memory_order_acquire) - (intptr_t) pos;
+            if(diff == 0){
+                if(head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            } else if(diff < 0){    // full; never block the caller
+                dropped.fetch_add(1, std::memory_order_relaxed);
+                return;
+            } else {
+                pos = head.load(std::memory_order_relaxed);
+            }
+        }
+
+        LogRecord &r = cell->record;
+        r.time_ns = now_ns();
+        r.code = code;
+        r.who = who;
+        for(int i = 0; i < LOG_MAX_ARGS; ++i)
+            r.args[i] = i < (int) sizeof...(Args) ? values[i + 1] : 0;
+        cell->seq.store(pos + 1, std::memory_order_release);
+    }
+
+    void write_chunk(uint32_t kind, const void *data, uint32_t size){
+        fwrite(&kind, sizeof(kind), 1, file);
+        fwrite(&size, sizeof(size), 1, file);
+        fwrite(data, 1, size, file);
+    }
+
+    // Writes new formats, then every record published so far.
+    void flush(){
+        std::vector<LogRecord> batch;
+        while(true){
+            Cell *cell = &cells[tail & (LOG_RING_SIZE - 1)];
+            if(cell->seq.load(std::memory_order_acquire) != tail + 1)
+                break;
+            batch.push_back(cell->record);
+            cell->seq.store(tail + LOG_RING_SIZE, std::memory_order_release);
+            ++tail;
+        }
+
+        // formats of the records above were registered before they were pushed
+        std::string table;
+        {
+            std::lock_guard<std::mutex> guard(formats_lock);
+            for(; formats_written < formats.size(); ++formats_written){
+                int32_t header[2] = {(int32_t) formats_written, styles[formats_written]};
+                table.append((const char *) header, sizeof(header));
+                table.append(formats[formats_written].c_str(), formats[formats_written].size() + 1);
+            }
+        }
+
+        if(!table.empty())
+            write_chunk(LOG_CHUNK_FORMATS, table.data(), table.size());
+        if(!batch.empty())
+            write_chunk(LOG_CHUNK_EVENTS, &batch[0], batch.size() * sizeof(LogRecord));
+        fflush(file);
+    }
+
+    void flush_loop(){
+        while(!stopping.load()){
+            usleep(LOG_FLUSH_MS * 1000);
+            flush();
+        }
+    }
+};
+
+inline EventLog &event_log(){
+    static EventLog log;
+    return log;
+}
+
+// Logs an event with int arguments; the format is registered on first use.
+#define LOG_EVENT(style, who, format, ...) \
+do{ \
+    static int _log_code = event_log().register_format(style, format); \
+    event_log().write(_log_code, who, ##__VA_ARGS__); \
+} while(0)
+
+#endif
@@ -0,0 +1,120 @@
+// Merges binary event logs (see event-log.h) by timestamp and prints them in
+// the usual text form.
+// usage: log-merge [-t] file...    (-t prefixes every line with its time in seconds)
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <unistd.h>
+#include <vector>
+#include "event-log.h"
+
+using std::string;
+using std::vector;
+
+struct LogFile {
+    vector<string> formats;
+    vector<int> styles;
+};
+
+struct Entry {
+    LogRecord record;
+    int file;
+    size_t index;       // position within its file; keeps ties in file order
+
+    bool operator<(const Entry &other) const {
+        if(record.time_ns != other.record.time_ns) return record.time_ns < other.record.time_ns;
+        if(file != other.file) return file < other.file;
+        return index < other.index;
+    }
+};
+
+bool read_log(const char *path, int id, LogFile &log, vector<Entry> &entries){
+    FILE *f = fopen(path, "rb");
+    if(f == NULL){
+        perror(path);
+        return false;
+    }
+
+    char magic[8];
+    if(fread(magic, 1, 8, f) != 8 || memcmp(magic, LOG_MAGIC, 8) != 0){
+        fprintf(stderr, "%s: not an event log\n", path);
+        fclose(f);
+        return false;
+    }
+
+    uint32_t kind, size;
+    size_t index = 0;
+    while(fread(&kind, sizeof(kind), 1, f) == 1 && fread(&size, sizeof(size), 1, f) == 1){
+        vector<char> data(size + 1);
+        if(fread(&data[0], 1, size, f) != size)
+            break;      // truncated tail of a log that was still being written
+
+        if(kind == LOG_CHUNK_FORMATS){
+            for(size_t pos = 0; pos + 2 * sizeof(int32_t) < size; ){
+                int32_t header[2];
+                memcpy(header, &data[pos], sizeof(header));
+                pos += sizeof(header);
+                string format(&data[pos]);
+                pos += format.size() + 1;
+
+                if((int) log.formats.size() <= header[0]){
+                    log.formats.resize(header[0] + 1);
+                    log.styles.resize(header[0] + 1);
+                }
+                log.formats[header[0]] = format;
+                log.styles[header[0]] = header[1];
+            }
+        } else if(kind == LOG_CHUNK_EVENTS){
+            for(size_t pos = 0; pos + sizeof(LogRecord) <= size; pos += sizeof(LogRecord)){
+                Entry e;
+                memcpy(&e.record, &data[pos], sizeof(LogRecord));
+                e.file = id;
+                e.index = index++;
+                entries.push_back(e);
+            }
+        }
+    }
+
+    fclose(f);
+    return true;
+}
+
+int main(int argc, char *argv[]){
+    int opt;
+    bool timestamps = false;
+    while((opt = getopt(argc, argv, "t")) != -1){
+        if(opt == 't') timestamps = true;
+        else {
+            fprintf(stderr, "usage: %s [-t] file...\n", argv[0]);
+            return 1;
+        }
+    }
+
+    vector<LogFile> logs(argc - optind);
+    vector<Entry> entries;
+    for(int i = optind; i < argc; ++i)
+        if(!read_log(argv[i], i - optind, logs[i - optind], entries))
+            return 1;
+
+    std::stable_sort(entries.begin(), entries.end());
+
+    char line[1024];
+    for(size_t i = 0; i < entries.size(); ++i){
+        const LogRecord &r = entries[i].record;
+        const LogFile &log = logs[entries[i].file];
+        if(r.code < 0 || r.code >= (int) log.formats.size())
+            continue;
+
+        snprintf(line, sizeof(line), log.formats[r.code].c_str(), r.args[0], r.args[1], r.args[2], r.args[3]);
+
+        if(timestamps)
+            printf("%.6f ", r.time_ns / 1e9);
+        if(log.styles[r.code] == LOG_MSG)
+            printf("<process %d> :: %s\n", r.who, line);
+        else
+            printf("%*s%s\n", r.who, "", line);
+    }
+    return 0;
+}